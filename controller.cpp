@@ -4,6 +4,11 @@
 Controller::Controller(const QString &configFile) : HOMEd(SERVICE_VERSION, configFile), m_database(new Database(getConfig(), this)), m_commands(QMetaEnum::fromType <Command> ())
 {
     connect(m_database, &Database::itemAdded, this, &Controller::itemAdded);
+    connect(m_database, &Database::backupProgress, this, &Controller::backupProgress);
+    connect(m_database, &Database::backupFinished, this, &Controller::backupFinished);
+    connect(m_database, &Database::exportFinished, this, &Controller::exportFinished);
+    connect(m_database, &Database::rebuildProgress, this, &Controller::rebuildProgress);
+    connect(m_database, &Database::rebuildFinished, this, &Controller::rebuildFinished);
 }
 
 Device Controller::findDevice(const QString &search)
@@ -81,12 +86,27 @@ void Controller::mqttReceived(const QByteArray &message, const QMqttTopicName &t
                 const Item &item = m_database->items().value(QString("%1/%2").arg(json.value("endpoint").toString(), json.value("property").toString()));
                 QList <Database::DataRecord> dataList;
                 QList <Database::HourRecord> hourList;
+                QList <Database::CountRecord> countList;
                 qint64 time = QDateTime::currentMSecsSinceEpoch();
 
                 if (!item.isNull())
-                    m_database->getData(item, json.value("start").toVariant().toLongLong(), json.value("end").toVariant().toLongLong(), dataList, hourList);
+                    m_database->getData(item, json.value("start").toVariant().toLongLong(), json.value("end").toVariant().toLongLong(), dataList, hourList, countList);
 
-                if (!hourList.count())
+                if (countList.count())
+                {
+                    QJsonArray timestamp, value, count;
+
+                    for (int i = 0; i < countList.count(); i++)
+                    {
+                        const Database::CountRecord &record = countList.at(i);
+                        timestamp.append(record.timestamp);
+                        value.append(record.value);
+                        count.append(QJsonValue::fromVariant(record.count));
+                    }
+
+                    mqttPublish(mqttTopic("recorder"), {{"id", json.value("id").toString()}, {"time", QDateTime::currentMSecsSinceEpoch() - time}, {"timestamp", timestamp}, {"value", value}, {"count", count}});
+                }
+                else if (!hourList.count())
                 {
                     QJsonArray timestamp, value;
 
@@ -117,6 +137,45 @@ void Controller::mqttReceived(const QByteArray &message, const QMqttTopicName &t
 
                 break;
             }
+
+            case Command::backupDatabase:
+            {
+                if (!m_database->backupDatabase(json.value("file").toString()))
+                    logWarning << "backup database request failed";
+
+                break;
+            }
+
+            case Command::exportData:
+            {
+                QString endpoint = json.value("endpoint").toString(), property = json.value("property").toString();
+                Item item;
+
+                if (!endpoint.isEmpty() || !property.isEmpty())
+                {
+                    item = m_database->items().value(QString("%1/%2").arg(endpoint, property));
+
+                    if (item.isNull())
+                    {
+                        logWarning << "export data request failed";
+                        exportFinished(json.value("file").toString(), false, 0, 0);
+                        break;
+                    }
+                }
+
+                if (!m_database->exportData(json.value("file").toString(), item, json.value("start").toVariant().toLongLong(), json.value("end").toVariant().toLongLong()))
+                    logWarning << "export data request failed";
+
+                break;
+            }
+
+            case Command::rebuildAggregates:
+            {
+                if (!m_database->rebuildAggregates(json.value("start").toVariant().toLongLong(), json.value("end").toVariant().toLongLong(), json.value("threads").toInt()))
+                    logWarning << "rebuild aggregates request failed";
+
+                break;
+            }
         }
     }
     else if (subTopic.startsWith("service/"))
@@ -275,3 +334,34 @@ void Controller::itemAdded(const Item &item)
 
     mqttPublish(mqttTopic("command/%1").arg(device->topic().mid(0, device->topic().lastIndexOf('/'))), {{"action", "getProperties"}, {"device", device->topic().split('/').last()}, {"service", "recorder"}});
 }
+
+void Controller::backupProgress(const QString &file, int progress)
+{
+    mqttPublish(mqttTopic("event/recorder"), {{"event", "backupProgress"}, {"file", file}, {"progress", progress}});
+}
+
+void Controller::backupFinished(const QString &file, bool success, qint64 time)
+{
+    mqttPublish(mqttTopic("event/recorder"), {{"event", success ? "backupFinished" : "backupFailed"}, {"file", file}, {"time", time}});
+}
+
+void Controller::exportFinished(const QString &file, bool success, quint32 count, qint64 time)
+{
+    mqttPublish(mqttTopic("event/recorder"), {{"event", success ? "exportFinished" : "exportFailed"}, {"file", file}, {"count", QJsonValue::fromVariant(count)}, {"time", time}});
+}
+
+void Controller::rebuildProgress(int progress)
+{
+    mqttPublish(mqttTopic("event/recorder"), {{"event", "rebuildProgress"}, {"progress", progress}});
+}
+
+void Controller::rebuildFinished(bool success, quint32 items, quint32 records, quint32 rows, int threads, qint64 time)
+{
+    if (!success)
+    {
+        mqttPublish(mqttTopic("event/recorder"), {{"event", "rebuildFailed"}});
+        return;
+    }
+
+    mqttPublish(mqttTopic("event/recorder"), {{"event", "rebuildFinished"}, {"items", QJsonValue::fromVariant(items)}, {"records", QJsonValue::fromVariant(records)}, {"rows", QJsonValue::fromVariant(rows)}, {"threads", threads}, {"time", time}, {"rate", time ? rows * 1000.0 / time : 0.0}});
+}
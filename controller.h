@@ -44,7 +44,10 @@ public:
         restartService,
         updateItem,
         removeItem,
-        getData
+        getData,
+        backupDatabase,
+        exportData,
+        rebuildAggregates
     };
 
     Controller(const QString &configFile);
@@ -73,6 +76,11 @@ private slots:
     void mqttReceived(const QByteArray &message, const QMqttTopicName &topic) override;
 
     void itemAdded(const Item &item);
+    void backupProgress(const QString &file, int progress);
+    void backupFinished(const QString &file, bool success, qint64 time);
+    void exportFinished(const QString &file, bool success, quint32 count, qint64 time);
+    void rebuildProgress(int progress);
+    void rebuildFinished(bool success, quint32 items, quint32 records, quint32 rows, int threads, qint64 time);
 
 };
 
@@ -12,13 +12,14 @@ bool ItemObject::skip(qint64 timestamp, double value)
     return false;
 }
 
-Database::Database(QSettings *config, QObject *parent) : QObject(parent), m_timer(new QTimer(this)), m_db(QSqlDatabase::addDatabase("QSQLITE", "db"))
+Database::Database(QSettings *config, QObject *parent) : QObject(parent), m_timer(new QTimer(this)), m_backupTimer(new QTimer(this)), m_exportTimer(new QTimer(this)), m_pool(new QThreadPool(this)), m_db(QSqlDatabase::addDatabase("QSQLITE", "db")), m_rebuildIndex(0), m_rebuildTasks(0), m_rebuildDone(0)
 {
     QSqlQuery query(m_db);
 
     m_db.setDatabaseName(config->value("database/file", "/opt/homed-recorder/homed-recorder.db").toString());
     m_days = static_cast <quint16> (config->value("database/days").toInt());
     m_debug = config->value("database/debug", false).toBool();
+    m_backupPath = config->value("database/backup").toString();
     m_trigger = {"action", "event", "scene"};
 
     if (!m_days)
@@ -35,9 +36,13 @@ Database::Database(QSettings *config, QObject *parent) : QObject(parent), m_time
     query.exec("CREATE TABLE IF NOT EXISTS item (id INTEGER PRIMARY KEY AUTOINCREMENT, endpoint TEXT NOT NULL, property TEXT NOT NULL, debounce INTEGER NOT NULL, threshold REAL NOT NULL)");
     query.exec("CREATE TABLE IF NOT EXISTS data (id INTEGER PRIMARY KEY AUTOINCREMENT, item_id INTEGER REFERENCES item(id) ON DELETE CASCADE, timestamp INTEGER NOT NULL, value TEXT NOT NULL)");
     query.exec("CREATE TABLE IF NOT EXISTS hour (id INTEGER PRIMARY KEY AUTOINCREMENT, item_id INTEGER REFERENCES item(id) ON DELETE CASCADE, timestamp INTEGER NOT NULL, avg REAL NOT NULL, min REAL NOT NULL, max REAL NOT NULL)");
+    query.exec("CREATE TABLE IF NOT EXISTS count (id INTEGER PRIMARY KEY AUTOINCREMENT, item_id INTEGER REFERENCES item(id) ON DELETE CASCADE, timestamp INTEGER NOT NULL, value TEXT NOT NULL, count INTEGER NOT NULL)");
     query.exec("CREATE UNIQUE INDEX item_index ON item (endpoint, property)");
+    query.exec("CREATE UNIQUE INDEX count_index ON count (item_id, timestamp, value)");
+    query.exec("CREATE INDEX hour_index ON hour (item_id, timestamp)");
 
     query.exec("PRAGMA foreign_keys = ON");
+    query.exec("PRAGMA journal_mode = WAL");
     query.exec("SELECT * FROM item");
 
     while (query.next())
@@ -47,11 +52,24 @@ Database::Database(QSettings *config, QObject *parent) : QObject(parent), m_time
     }
 
     connect(m_timer, &QTimer::timeout, this, &Database::update);
+    connect(m_backupTimer, &QTimer::timeout, this, &Database::backupStep);
+    connect(m_exportTimer, &QTimer::timeout, this, &Database::exportStep);
+
     m_timer->start(1000);
 }
 
 Database::~Database(void)
 {
+    if (m_backupTimer->isActive())
+        finishBackup(false);
+
+    if (m_exportFile.isOpen())
+        finishExport(false);
+
+    m_pool->clear();
+    m_pool->waitForDone();
+    qDeleteAll(m_rebuildList);
+
     m_db.close();
     m_db = QSqlDatabase();
     QSqlDatabase::removeDatabase("db");
@@ -99,6 +117,7 @@ bool Database::removeItem(const QString &endpoint, const QString &property)
 void Database::insertData(const Item &item, const QString &value)
 {
     qint64 timestamp = QDateTime::currentMSecsSinceEpoch();
+    bool check;
 
     if (!item->timestamp())
     {
@@ -120,6 +139,10 @@ void Database::insertData(const Item &item, const QString &value)
     }
 
     m_dataQueue.enqueue({item->id(), timestamp, value});
+    value.toDouble(&check);
+
+    if (value != UNAVAILABLE_STRING && (m_trigger.contains(item->property()) || !check))
+        m_countQueue.enqueue({item->id(), ((timestamp - 1) / HOUR_INTERVAL + 1) * HOUR_INTERVAL, value, 1});
 
     if (m_debug)
         logInfo << "Endpoint" << item->endpoint() << "property" << item->property() << "value" << value << "record enqueued";
@@ -128,13 +151,19 @@ void Database::insertData(const Item &item, const QString &value)
     item->setValue(value);
 }
 
-void Database::getData(const Item &item, qint64 start, qint64 end, QList <DataRecord> &dataList, QList <HourRecord> &hourList)
+void Database::getData(const Item &item, qint64 start, qint64 end, QList <DataRecord> &dataList, QList <HourRecord> &hourList, QList <CountRecord> &countList)
 {
     QSqlQuery query(m_db);
-    QString queryString;
+    QString queryString, range;
     bool check = false;
     qint64 last = 0;
 
+    if (start)
+        range.append(QString(" AND timestamp > %1").arg(start));
+
+    if (end)
+        range.append(QString(" AND timestamp <= %1").arg(end));
+
     if (start && m_days >= (QDateTime::currentMSecsSinceEpoch() - start) / 86400000)
     {
         queryString = QString("SELECT timestamp, value FROM data WHERE item_id = %1").arg(item->id());
@@ -145,16 +174,11 @@ void Database::getData(const Item &item, qint64 start, qint64 end, QList <DataRe
 
         check = true;
     }
-    else
+    else if (!m_trigger.contains(item->property()))
         queryString = QString("SELECT timestamp, avg, min, max FROM hour WHERE item_id = %1").arg(item->id());
 
-    if (start)
-        queryString.append(QString(" AND timestamp > %1").arg(start));
-
-    if (end)
-        queryString.append(QString(" AND timestamp <= %1").arg(end));
-
-    query.exec(queryString);
+    if (!queryString.isEmpty())
+        query.exec(queryString.append(range).append(check ? QString() : QString(" ORDER BY timestamp")));
 
     while (query.next())
     {
@@ -170,11 +194,392 @@ void Database::getData(const Item &item, qint64 start, qint64 end, QList <DataRe
 
         last = timestamp;
     }
+
+    if (check || !hourList.isEmpty())
+        return;
+
+    query.exec(QString("SELECT timestamp, value, count FROM count WHERE item_id = %1%2 ORDER BY timestamp").arg(item->id()).arg(range));
+
+    while (query.next())
+        countList.append({item->id(), query.value(0).toLongLong(), query.value(1).toString(), static_cast <quint32> (query.value(2).toInt())});
 }
 
-void Database::update(void)
+bool Database::backupDatabase(const QString &file)
+{
+    QString target = targetFile(file, ".backup"), temp = QString(target).append(".tmp");
+    bool check = true;
+
+    if (m_backupTimer->isActive() || target.isEmpty())
+    {
+        emit backupFinished(file, false, 0);
+        return false;
+    }
+
+    m_backupFile = target;
+    m_backupStart = QDateTime::currentMSecsSinceEpoch();
+    QFile::remove(temp);
+
+    m_backupDb = QSqlDatabase::addDatabase("QSQLITE", "backup");
+    m_backupDb.setDatabaseName(m_db.databaseName());
+
+    if (!m_backupDb.open())
+    {
+        finishBackup(false);
+        return false;
+    }
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", "backup_target");
+        db.setDatabaseName(temp);
+
+        if (db.open())
+        {
+            QSqlQuery schema("SELECT sql FROM sqlite_master WHERE sql NOT NULL AND name NOT LIKE 'sqlite_%' ORDER BY type DESC", m_backupDb), query(db);
+
+            while (check && schema.next())
+                check = query.exec(schema.value(0).toString());
+
+            db.close();
+        }
+        else
+            check = false;
+    }
+
+    QSqlDatabase::removeDatabase("backup_target");
+
+    {
+        QSqlQuery query(m_backupDb);
+
+        if (!check || !query.exec(QString("ATTACH DATABASE '%1' AS backup").arg(QString(temp).replace("'", "''"))) || !query.exec("BEGIN TRANSACTION") || !query.exec("INSERT INTO backup.item SELECT * FROM main.item") || !query.exec("SELECT IFNULL((SELECT MAX(id) FROM count), 0) + IFNULL((SELECT MAX(id) FROM data), 0) + IFNULL((SELECT MAX(id) FROM hour), 0)") || !query.first())
+            check = false;
+        else
+            m_backupTotal = query.value(0).toLongLong();
+    }
+
+    if (!check)
+    {
+        finishBackup(false);
+        return false;
+    }
+
+    logInfo << "Database backup to" << m_backupFile << "started";
+
+    m_backupTables = {"count", "data", "hour"};
+    m_backupId = 0;
+    m_backupDone = 0;
+    m_backupProgress = -1;
+    m_backupTimer->start(BACKUP_STEP_DELAY);
+
+    return true;
+}
+
+bool Database::exportData(const QString &file, const Item &item, qint64 start, qint64 end)
+{
+    QString target = targetFile(file, ".csv");
+    bool check;
+
+    if (m_exportFile.isOpen() || target.isEmpty())
+    {
+        emit exportFinished(file, false, 0, 0);
+        return false;
+    }
+
+    m_exportFile.setFileName(target);
+    m_exportStart = QDateTime::currentMSecsSinceEpoch();
+    m_exportCount = 0;
+
+    if (!m_exportFile.open(QFile::WriteOnly))
+    {
+        emit exportFinished(target, false, 0, 0);
+        return false;
+    }
+
+    m_exportItems.clear();
+    m_exportFilter.clear();
+
+    check = m_exportFile.write("id,endpoint,property\n") >= 0;
+
+    for (auto it = m_items.begin(); check && it != m_items.end(); it++)
+    {
+        if (!item.isNull() && it.value() != item)
+            continue;
+
+        m_exportItems.insert(it.value()->id());
+        check = m_exportFile.write(QString("%1,%2,%3\n").arg(QString::number(it.value()->id()), exportValue(it.value()->endpoint()), exportValue(it.value()->property())).toUtf8()) >= 0;
+    }
+
+    if (!check || m_exportFile.write("\nid,timestamp,value\n") < 0)
+    {
+        finishExport(false);
+        return false;
+    }
+
+    {
+        QSqlQuery query("SELECT IFNULL(MAX(id), 0) FROM data", m_db);
+        m_exportLast = query.first() ? query.value(0).toLongLong() : 0;
+
+        if (!item.isNull())
+            query.exec("CREATE INDEX IF NOT EXISTS data_index ON data (item_id, timestamp)");
+    }
+
+    if (start && item.isNull())
+        m_exportFilter.append(QString(" AND timestamp > %1").arg(start));
+
+    if (end)
+        m_exportFilter.append(QString(" AND timestamp <= %1").arg(end));
+
+    logInfo << "Data export to" << m_exportFile.fileName() << "started";
+
+    m_exportItem = item.isNull() ? 0 : item->id();
+    m_exportTimestamp = start;
+    m_exportId = item.isNull() ? 0 : m_exportLast;
+    m_exportTimer->start(EXPORT_STEP_DELAY);
+
+    return true;
+}
+
+bool Database::rebuildAggregates(qint64 start, qint64 end, int threads)
+{
+    qint64 time = QDateTime::currentMSecsSinceEpoch(), begin = ((time - m_days * 86400000LL) / HOUR_INTERVAL + 1) * HOUR_INTERVAL, limit = time / HOUR_INTERVAL * HOUR_INTERVAL - HOUR_INTERVAL, length;
+    QList <QList <RebuildTask::ItemStruct>> batches;
+    QSqlQuery query(m_db);
+    int slices;
+
+    start = start ? qMax(start / HOUR_INTERVAL * HOUR_INTERVAL, begin) : begin;
+    end = end ? qMin(end / HOUR_INTERVAL * HOUR_INTERVAL, limit) : limit;
+
+    if (m_rebuildDone < m_rebuildTasks || start >= end || m_items.isEmpty())
+    {
+        emit rebuildFinished(false, 0, 0, 0, 0, 0);
+        return false;
+    }
+
+    threads = threads > 0 ? qBound(1, threads, QThread::idealThreadCount()) : QThread::idealThreadCount();
+    m_pool->setMaxThreadCount(threads);
+
+    flush();
+    query.exec("CREATE INDEX IF NOT EXISTS data_index ON data (item_id, timestamp)");
+
+    for (auto it = m_items.begin(); it != m_items.end(); it++)
+    {
+        if (batches.isEmpty() || batches.last().count() >= REBUILD_TASK_ITEMS)
+            batches.append(QList <RebuildTask::ItemStruct> ());
+
+        batches.last().append({it.value()->id(), m_trigger.contains(it.value()->property())});
+    }
+
+    slices = static_cast <int> (qMin(static_cast <qint64> (qMax(1, threads * REBUILD_TASK_FACTOR / batches.count())), (end - start) / HOUR_INTERVAL));
+    length = ((end - start) / HOUR_INTERVAL + slices - 1) / slices * HOUR_INTERVAL;
+
+    m_rebuildStart = time;
+    m_rebuildTasks = 0;
+    m_rebuildDone = 0;
+    m_rebuildItems = static_cast <quint32> (m_items.count());
+    m_rebuildRecords = 0;
+    m_rebuildRows = 0;
+    m_rebuildSlices.clear();
+
+    logInfo << "Aggregates rebuild for" << m_rebuildItems << "items started with" << threads << "threads";
+
+    for (int i = 0; i < batches.count(); i++)
+    {
+        for (qint64 timestamp = start; timestamp < end; timestamp += length)
+        {
+            RebuildTask *task = new RebuildTask(m_db.databaseName(), m_rebuildIndex++, timestamp, qMin(timestamp + length, end), timestamp == start);
+
+            task->items() = batches.at(i);
+            connect(task, &RebuildTask::finished, this, [this, task] () { storeRebuild(task); });
+
+            m_rebuildList.append(task);
+            m_rebuildTasks++;
+        }
+    }
+
+    for (int i = 0; i < m_rebuildList.count(); i++)
+        m_pool->start(m_rebuildList.at(i));
+
+    return true;
+}
+
+void Database::storeRebuild(RebuildTask *task)
+{
+    QSqlQuery query(m_db);
+    QStringList list;
+    qint64 time;
+
+    for (int i = 0; i < task->items().count(); i++)
+        list.append(QString::number(task->items().at(i).id));
+
+    query.exec("BEGIN TRANSACTION");
+    query.exec(QString("DELETE FROM hour WHERE item_id IN (%1) AND timestamp > %2 AND timestamp <= %3").arg(list.join(',')).arg(task->start()).arg(task->end()));
+    query.exec(QString("DELETE FROM count WHERE item_id IN (%1) AND timestamp > %2 AND timestamp <= %3").arg(list.join(',')).arg(task->start()).arg(task->end()));
+
+    for (int i = 0; i < task->hourList().count(); i++)
+    {
+        const HourRecord &record = task->hourList().at(i);
+        query.exec(QString("INSERT INTO hour (item_id, timestamp, avg, min, max) VALUES (%1, %2, %3, %4, %5)").arg(record.id).arg(record.timestamp).arg(record.avg, record.min, record.max));
+    }
+
+    for (int i = 0; i < task->countList().count(); i++)
+    {
+        const CountRecord &record = task->countList().at(i);
+        query.exec(QString("INSERT INTO count (item_id, timestamp, value, count) VALUES (%1, %2, '%3', %4)").arg(record.id).arg(record.timestamp).arg(record.value).arg(record.count));
+    }
+
+    query.exec("COMMIT");
+
+    for (int i = 0; i < task->sliceList().count(); i++)
+    {
+        const SliceRecord &record = task->sliceList().at(i);
+        m_rebuildSlices[record.id].insert(task->start(), record);
+    }
+
+    m_rebuildDone++;
+    m_rebuildRecords += static_cast <quint32> (task->hourList().count() + task->countList().count());
+    m_rebuildRows += task->rows();
+
+    task->hourList().clear();
+    task->countList().clear();
+    task->sliceList().clear();
+
+    emit rebuildProgress(static_cast <int> (m_rebuildDone * 100 / m_rebuildTasks));
+
+    if (m_rebuildDone < m_rebuildTasks)
+        return;
+
+    query.exec("BEGIN TRANSACTION");
+
+    for (auto it = m_rebuildSlices.begin(); it != m_rebuildSlices.end(); it++)
+    {
+        SliceRecord carry;
+
+        for (auto slice = it.value().begin(); slice != it.value().end(); slice++)
+        {
+            for (int i = 0; !carry.avg.isEmpty() && i < slice.value().pending.count(); i++)
+            {
+                query.exec(QString("INSERT INTO hour (item_id, timestamp, avg, min, max) VALUES (%1, %2, %3, %4, %5)").arg(it.key()).arg(slice.value().pending.at(i)).arg(carry.avg, carry.min, carry.max));
+                m_rebuildRecords++;
+            }
+
+            if (!slice.value().avg.isEmpty())
+                carry = slice.value();
+        }
+    }
+
+    query.exec("COMMIT");
+
+    m_rebuildSlices.clear();
+    m_pool->waitForDone();
+
+    for (int i = 0; i < m_rebuildList.count(); i++)
+        m_rebuildList.at(i)->deleteLater();
+
+    m_rebuildList.clear();
+
+    time = QDateTime::currentMSecsSinceEpoch() - m_rebuildStart;
+    logInfo << "Aggregates rebuild finished with" << m_rebuildRecords << "records from" << m_rebuildRows << "rows in" << time << "ms";
+    emit rebuildFinished(true, m_rebuildItems, m_rebuildRecords, m_rebuildRows, m_pool->maxThreadCount(), time);
+}
+
+QString Database::targetFile(const QString &file, const QString &suffix)
+{
+    QFileInfo database(m_db.databaseName()), info;
+    QDir dir(m_backupPath.isEmpty() ? database.absolutePath() : m_backupPath);
+    QList <QString> list = {QString(), "-wal", "-shm", "-journal", ".tmp"};
+    QString path;
+
+    if (!dir.exists())
+        return QString();
+
+    info.setFile(QDir::cleanPath(dir.absoluteFilePath(file.isEmpty() ? QString(database.fileName()).append(suffix) : file)));
+
+    if (info.fileName().isEmpty() || info.isSymLink() || info.isDir() || info.absoluteDir().canonicalPath() != dir.canonicalPath())
+        return QString();
+
+    path = QString("%1/%2").arg(dir.canonicalPath(), info.fileName());
+
+    for (int i = 0; i < list.count(); i++)
+    {
+        QString name = QString(database.canonicalFilePath()).append(list.at(i));
+
+        if (path == name || QString(path).append(".tmp") == name)
+            return QString();
+    }
+
+    return path;
+}
+
+QString Database::exportValue(QString value)
+{
+    if (value.contains(',') || value.contains('"') || value.contains('\n'))
+        value = QString("\"%1\"").arg(value.replace("\"", "\"\""));
+
+    return value;
+}
+
+void Database::finishBackup(bool success)
+{
+    QString temp = QString(m_backupFile).append(".tmp");
+    qint64 time = QDateTime::currentMSecsSinceEpoch() - m_backupStart;
+
+    m_backupTimer->stop();
+
+    if (m_backupDb.isOpen())
+    {
+        QSqlQuery query(m_backupDb);
+
+        if (!query.exec(success ? "COMMIT" : "ROLLBACK"))
+            success = false;
+
+        query.exec("DETACH DATABASE backup");
+        m_backupDb.close();
+    }
+    else
+        success = false;
+
+    m_backupDb = QSqlDatabase();
+    QSqlDatabase::removeDatabase("backup");
+
+    if (success)
+    {
+        QFile::remove(m_backupFile);
+        success = QFile::rename(temp, m_backupFile);
+    }
+    else
+        QFile::remove(temp);
+
+    if (success)
+        logInfo << "Database backup to" << m_backupFile << "finished in" << time << "ms";
+    else
+        logWarning << "Database backup to" << m_backupFile << "failed";
+
+    emit backupFinished(m_backupFile, success, time);
+}
+
+void Database::finishExport(bool success)
+{
+    qint64 time = QDateTime::currentMSecsSinceEpoch() - m_exportStart;
+
+    m_exportTimer->stop();
+
+    if (!m_exportFile.flush() || m_exportFile.error() != QFile::NoError)
+        success = false;
+
+    m_exportFile.close();
+
+    if (success)
+        logInfo << "Data export to" << m_exportFile.fileName() << "finished with" << m_exportCount << "records in" << time << "ms";
+    else
+    {
+        logWarning << "Data export to" << m_exportFile.fileName() << "failed";
+        m_exportFile.remove();
+    }
+
+    emit exportFinished(m_exportFile.fileName(), success, m_exportCount, time);
+}
+
+void Database::flush(void)
 {
-    qint64 timestamp = QDateTime::currentSecsSinceEpoch(), start = QDateTime::currentMSecsSinceEpoch();
     QSqlQuery query(m_db);
 
     query.exec("BEGIN TRANSACTION");
@@ -185,7 +590,21 @@ void Database::update(void)
         query.exec(QString("INSERT INTO data (item_id, timestamp, value) VALUES (%1, %2, '%3')").arg(record.id).arg(record.timestamp).arg(record.value));
     }
 
+    while (!m_countQueue.isEmpty())
+    {
+        CountRecord record = m_countQueue.dequeue();
+        query.exec(QString("INSERT INTO count (item_id, timestamp, value, count) VALUES (%1, %2, '%3', %4) ON CONFLICT (item_id, timestamp, value) DO UPDATE SET count = count + excluded.count").arg(record.id).arg(record.timestamp).arg(record.value).arg(record.count));
+    }
+
     query.exec("COMMIT");
+}
+
+void Database::update(void)
+{
+    qint64 timestamp = QDateTime::currentSecsSinceEpoch(), start = QDateTime::currentMSecsSinceEpoch();
+    QSqlQuery query(m_db);
+
+    flush();
 
     if (timestamp % 3600)
         return;
@@ -198,7 +617,7 @@ void Database::update(void)
         query.exec("REINDEX data");
     }
 
-    query.exec(QString("SELECT item.id, AVG(data.value), MIN(data.value), MAX(data.value) FROM item LEFT JOIN data ON data.item_id = item.id AND data.timestamp > %1 GROUP by item.id").arg((timestamp - 3600) * 1000));
+    query.exec(QString("SELECT item.id, AVG(data.value), MIN(data.value), MAX(data.value) FROM item LEFT JOIN data ON data.item_id = item.id AND data.timestamp > %1 WHERE item.property NOT IN ('%2') GROUP by item.id").arg((timestamp - 3600) * 1000).arg(QStringList(m_trigger).join("', '")));
 
     while (query.next())
     {
@@ -223,7 +642,7 @@ void Database::update(void)
             if (!query.first() || query.value(0).toString() == UNAVAILABLE_STRING)
                 continue;
 
-            query.exec(QString("SELECT avg, min, max FROM hour WHERE item_id = %1 ORDER BY id DESC limit 1").arg(id));
+            query.exec(QString("SELECT avg, min, max FROM hour WHERE item_id = %1 ORDER BY timestamp DESC limit 1").arg(id));
 
             if (!query.first())
                 continue;
@@ -243,9 +662,232 @@ void Database::update(void)
     query.exec("COMMIT");
     logInfo << "Hour data stored in" << QDateTime::currentMSecsSinceEpoch() - start << "ms";
 
-    if (QDateTime::currentDateTime().time().hour())
+    if (QDateTime::currentDateTime().time().hour() || m_backupTimer->isActive())
         return;
 
     query.exec(QString("DELETE FROM data WHERE timestamp < %1 AND ID NOT IN (SELECT MAX(id) FROM data WHERE timestamp < %1 GROUP BY item_id)").arg((timestamp - m_days * 86400) * 1000));
     query.exec("VACUUM");
 }
+
+void Database::backupStep(void)
+{
+    QString table = m_backupTables.first();
+    bool check = false;
+    int rows = 0, progress;
+
+    {
+        QSqlQuery query(m_backupDb);
+
+        if (query.exec(QString("INSERT INTO backup.%1 SELECT * FROM main.%1 WHERE id > %2 ORDER BY id LIMIT %3").arg(table).arg(m_backupId).arg(BACKUP_STEP_ROWS)))
+        {
+            rows = query.numRowsAffected();
+
+            if (query.exec(QString("SELECT IFNULL(MAX(id), 0) FROM backup.%1").arg(table)) && query.first())
+            {
+                m_backupDone += query.value(0).toLongLong() - m_backupId;
+                m_backupId = query.value(0).toLongLong();
+                check = true;
+            }
+        }
+    }
+
+    if (!check)
+    {
+        finishBackup(false);
+        return;
+    }
+
+    if (rows < BACKUP_STEP_ROWS)
+    {
+        m_backupTables.removeFirst();
+        m_backupId = 0;
+
+        if (m_backupTables.isEmpty())
+        {
+            finishBackup(true);
+            return;
+        }
+    }
+
+    progress = m_backupTotal ? static_cast <int> (qMin(m_backupDone * 100 / m_backupTotal, 100LL)) : 0;
+
+    if (m_backupProgress == progress)
+        return;
+
+    m_backupProgress = progress;
+    emit backupProgress(m_backupFile, progress);
+}
+
+void Database::exportStep(void)
+{
+    QSqlQuery query(m_db);
+    qint64 limit = qMin(m_exportId + EXPORT_STEP_ROWS, m_exportLast);
+    int count = 0;
+
+    if (m_exportItem)
+        query.exec(QString("SELECT id, item_id, timestamp, value FROM data WHERE item_id = %1 AND (timestamp, id) > (%2, %3) AND id <= %4%5 ORDER BY timestamp, id LIMIT %6").arg(m_exportItem).arg(m_exportTimestamp).arg(m_exportId).arg(m_exportLast).arg(m_exportFilter).arg(EXPORT_STEP_ROWS));
+    else
+        query.exec(QString("SELECT id, item_id, timestamp, value FROM data WHERE id > %1 AND id <= %2%3 ORDER BY id").arg(m_exportId).arg(limit).arg(m_exportFilter));
+
+    while (query.next())
+    {
+        quint32 id = static_cast <quint32> (query.value(1).toInt());
+
+        if (m_exportItem)
+        {
+            m_exportTimestamp = query.value(2).toLongLong();
+            m_exportId = query.value(0).toLongLong();
+            count++;
+        }
+
+        if (!m_exportItems.contains(id))
+            continue;
+
+        if (m_exportFile.write(QString("%1,%2,%3\n").arg(QString::number(id), query.value(2).toString(), exportValue(query.value(3).toString())).toUtf8()) < 0)
+        {
+            finishExport(false);
+            return;
+        }
+
+        m_exportCount++;
+    }
+
+    if (query.lastError().type() != QSqlError::NoError)
+    {
+        finishExport(false);
+        return;
+    }
+
+    if (m_exportItem ? count == EXPORT_STEP_ROWS : limit < m_exportLast)
+    {
+        if (!m_exportItem)
+            m_exportId = limit;
+
+        return;
+    }
+
+    finishExport(true);
+}
+
+void RebuildTask::run(void)
+{
+    QString connection = QString("rebuild_%1").arg(m_index);
+
+    {
+        QSqlDatabase db = QSqlDatabase::addDatabase("QSQLITE", connection);
+
+        db.setDatabaseName(m_file);
+        db.setConnectOptions("QSQLITE_OPEN_READONLY");
+
+        if (db.open())
+        {
+            QSqlQuery query(db);
+
+            for (int i = 0; i < m_items.count(); i++)
+                processItem(query, m_items.at(i));
+
+            db.close();
+        }
+    }
+
+    QSqlDatabase::removeDatabase(connection);
+    emit finished();
+}
+
+void RebuildTask::processItem(QSqlQuery &query, const ItemStruct &item)
+{
+    QMap <QString, quint32> counts;
+    QString last, avg, min, max;
+    QList <qint64> pendingList;
+    qint64 hour = m_start + HOUR_INTERVAL;
+    double sum = 0, minValue = 0, maxValue = 0;
+    quint32 numbers = 0;
+    bool valid = true, pending;
+
+    if (m_seed && !item.trigger)
+    {
+        query.exec(QString("SELECT avg, min, max FROM hour WHERE item_id = %1 AND timestamp <= %2 ORDER BY timestamp DESC LIMIT 1").arg(item.id).arg(m_start));
+
+        if (query.first())
+        {
+            avg = query.value(0).toString();
+            min = query.value(1).toString();
+            max = query.value(2).toString();
+        }
+    }
+
+    query.exec(QString("SELECT value FROM data WHERE item_id = %1 AND timestamp <= %2 ORDER BY timestamp DESC LIMIT 1").arg(item.id).arg(m_start));
+
+    if (query.first())
+        last = query.value(0).toString();
+
+    query.setForwardOnly(true);
+    query.exec(QString("SELECT timestamp, value FROM data WHERE item_id = %1 AND timestamp > %2 AND timestamp <= %3 ORDER BY timestamp").arg(item.id).arg(m_start).arg(m_end));
+    pending = query.next();
+
+    while (hour <= m_end)
+    {
+        if (pending && query.value(0).toLongLong() <= hour)
+        {
+            bool check;
+            double value;
+
+            last = query.value(1).toString();
+            value = last.toDouble(&check);
+
+            if (last != UNAVAILABLE_STRING && (item.trigger || !check))
+                counts[last]++;
+
+            if (check)
+            {
+                minValue = numbers && minValue < value ? minValue : value;
+                maxValue = numbers && maxValue > value ? maxValue : value;
+                sum += value;
+                numbers++;
+            }
+            else
+                valid = false;
+
+            m_rows++;
+            pending = query.next();
+            continue;
+        }
+
+        for (auto it = counts.begin(); it != counts.end(); it++)
+            m_countList.append({item.id, hour, it.key(), it.value()});
+
+        if (item.trigger)
+        {
+            counts.clear();
+            hour += HOUR_INTERVAL;
+            continue;
+        }
+
+        if (valid && numbers)
+        {
+            avg = QString::number(sum / numbers, 'g', 15);
+            min = QString::number(minValue, 'g', 15);
+            max = QString::number(maxValue, 'g', 15);
+            m_hourList.append({item.id, hour, avg, min, max});
+        }
+        else if (valid && !last.isEmpty() && last != UNAVAILABLE_STRING)
+        {
+            if (!avg.isEmpty())
+                m_hourList.append({item.id, hour, avg, min, max});
+            else if (!m_seed)
+                pendingList.append(hour);
+        }
+
+        counts.clear();
+        sum = 0;
+        numbers = 0;
+        valid = true;
+        hour += HOUR_INTERVAL;
+    }
+
+    query.finish();
+    query.setForwardOnly(false);
+
+    if (!pendingList.isEmpty() || !avg.isEmpty())
+        m_sliceList.append({item.id, pendingList, avg, min, max});
+}
@@ -3,6 +3,14 @@
 
 #define UNAVAILABLE_STRING  "[unavailable]"
 #define DATA_INDEX_LIMIT    100000
+#define HOUR_INTERVAL       3600000
+
+#define BACKUP_STEP_ROWS    1000
+#define BACKUP_STEP_DELAY   10
+#define EXPORT_STEP_ROWS    1000
+#define EXPORT_STEP_DELAY   10
+#define REBUILD_TASK_ITEMS  16
+#define REBUILD_TASK_FACTOR 4
 
 #include <QtSql>
 
@@ -48,6 +56,8 @@ private:
 
 };
 
+class RebuildTask;
+
 class Database : public QObject
 {
     Q_OBJECT
@@ -71,6 +81,21 @@ public:
         QString avg, min, max;
     };
 
+    struct CountRecord
+    {
+        quint32 id;
+        qint64  timestamp;
+        QString value;
+        quint32 count;
+    };
+
+    struct SliceRecord
+    {
+        quint32 id;
+        QList <qint64> pending;
+        QString avg, min, max;
+    };
+
     inline bool debug(void) { return m_debug; }
     inline QMap <QString, Item> &items(void) { return m_items; }
 
@@ -78,11 +103,16 @@ public:
     bool removeItem(const QString &endpoint, const QString &property);
 
     void insertData(const Item &item, const QString &value);
-    void getData(const Item &item, qint64 start, qint64 end, QList <DataRecord> &dataList, QList <HourRecord> &hourList);
+    void getData(const Item &item, qint64 start, qint64 end, QList <DataRecord> &dataList, QList <HourRecord> &hourList, QList <CountRecord> &countList);
+
+    bool backupDatabase(const QString &file);
+    bool exportData(const QString &file, const Item &item, qint64 start, qint64 end);
+    bool rebuildAggregates(qint64 start, qint64 end, int threads);
 
 private:
 
-    QTimer *m_timer;
+    QTimer *m_timer, *m_backupTimer, *m_exportTimer;
+    QThreadPool *m_pool;
     QSqlDatabase m_db;
     quint16 m_days;
     bool m_debug;
@@ -92,14 +122,94 @@ private:
 
     QQueue <DataRecord> m_dataQueue;
     QQueue <HourRecord> m_hourQueue;
+    QQueue <CountRecord> m_countQueue;
+
+    QSqlDatabase m_backupDb;
+    QString m_backupPath, m_backupFile;
+    QList <QString> m_backupTables;
+    qint64 m_backupStart, m_backupId, m_backupTotal, m_backupDone;
+    int m_backupProgress;
+
+    QFile m_exportFile;
+    QSet <quint32> m_exportItems;
+    QString m_exportFilter;
+    qint64 m_exportTimestamp, m_exportId, m_exportLast, m_exportStart;
+    quint32 m_exportItem, m_exportCount;
+
+    qint64 m_rebuildStart;
+    quint32 m_rebuildIndex, m_rebuildTasks, m_rebuildDone, m_rebuildItems, m_rebuildRecords, m_rebuildRows;
+    QList <RebuildTask*> m_rebuildList;
+    QMap <quint32, QMap <qint64, SliceRecord>> m_rebuildSlices;
+
+    QString targetFile(const QString &file, const QString &suffix);
+    QString exportValue(QString value);
+
+    void finishBackup(bool success);
+    void finishExport(bool success);
+    void storeRebuild(RebuildTask *task);
+    void flush(void);
 
 private slots:
 
     void update(void);
+    void backupStep(void);
+    void exportStep(void);
 
 signals:
 
     void itemAdded(const Item &item);
+    void backupProgress(const QString &file, int progress);
+    void backupFinished(const QString &file, bool success, qint64 time);
+    void exportFinished(const QString &file, bool success, quint32 count, qint64 time);
+    void rebuildProgress(int progress);
+    void rebuildFinished(bool success, quint32 items, quint32 records, quint32 rows, int threads, qint64 time);
+
+};
+
+class RebuildTask : public QObject, public QRunnable
+{
+    Q_OBJECT
+
+public:
+
+    struct ItemStruct
+    {
+        quint32 id;
+        bool trigger;
+    };
+
+    RebuildTask(const QString &file, quint32 index, qint64 start, qint64 end, bool seed) :
+        m_file(file), m_index(index), m_start(start), m_end(end), m_seed(seed), m_rows(0) { setAutoDelete(false); }
+
+    inline qint64 start(void) { return m_start; }
+    inline qint64 end(void) { return m_end; }
+
+    inline QList <ItemStruct> &items(void) { return m_items; }
+    inline QList <Database::HourRecord> &hourList(void) { return m_hourList; }
+    inline QList <Database::CountRecord> &countList(void) { return m_countList; }
+    inline QList <Database::SliceRecord> &sliceList(void) { return m_sliceList; }
+    inline quint32 rows(void) { return m_rows; }
+
+    void run(void) override;
+
+private:
+
+    QString m_file;
+    quint32 m_index;
+    qint64 m_start, m_end;
+    bool m_seed;
+    quint32 m_rows;
+
+    QList <ItemStruct> m_items;
+    QList <Database::HourRecord> m_hourList;
+    QList <Database::CountRecord> m_countList;
+    QList <Database::SliceRecord> m_sliceList;
+
+    void processItem(QSqlQuery &query, const ItemStruct &item);
+
+signals:
+
+    void finished(void);
 
 };
 